@@ -69,8 +69,10 @@ int jbmp_read_file_header(FILE* f, jbmp_header_t* h, int verbose)
   return fp;
 }
 
-int jbmp_read_file_bitmap(FILE* f, jbmp_header_t header, jbmp_bitmap_t* bitmap,
-                          int verbose)
+// reads the rows of the bitmap; if 'hs' is not NULL each row is added to the
+// content hash as soon as it has been decoded.
+static int jbmp_read_rows(FILE* f, jbmp_header_t header, jbmp_bitmap_t* bitmap,
+                          jbmp_hash_state_t* hs, int verbose)
 {
   int row_size_bytes = (((header.width*3)+3)/4) * 4;
   int row_pad_bytes = row_size_bytes - (header.width*3);
@@ -99,6 +101,8 @@ int jbmp_read_file_bitmap(FILE* f, jbmp_header_t header, jbmp_bitmap_t* bitmap,
     // pointer to make up the difference, if any.
     fseek(f, row_pad_bytes, SEEK_CUR);
     
+    if (hs != NULL) jbmp_hash_row(hs, j, &bitmap->bitmap[j * bitmap->width]);
+    
     if (verbose > 0 && line % verbose == 0)
     {
       printf("\rreading line %i / %i", line, header.height-1);
@@ -113,9 +117,22 @@ int jbmp_read_file_bitmap(FILE* f, jbmp_header_t header, jbmp_bitmap_t* bitmap,
   return a;
 }
 
+int jbmp_read_file_bitmap(FILE* f, jbmp_header_t header, jbmp_bitmap_t* bitmap,
+                          int verbose)
+{
+  return jbmp_read_rows(f, header, bitmap, NULL, verbose);
+}
+
 int jbmp_read_bmp_file(char* fname, jbmp_bitmap_t* bitmap, int verbose)
+{
+  return jbmp_read_bmp_file_hash(fname, bitmap, NULL, verbose);
+}
+
+int jbmp_read_bmp_file_hash(char* fname, jbmp_bitmap_t* bitmap, uint64_t* hash,
+                            int verbose)
 {
   FILE* f;
+  jbmp_hash_state_t hs;
   jbmp_header_t header;
   unsigned long fp;
   char file_exists = 0;
@@ -135,7 +152,7 @@ int jbmp_read_bmp_file(char* fname, jbmp_bitmap_t* bitmap, int verbose)
   }
 
   // file exists, so read the header
-  int c = jbmp_read_file_header(f, &header, 1);
+  int c = jbmp_read_file_header(f, &header, verbose);
   
   // close the file while we check the validity
   fclose(f);
@@ -188,7 +205,9 @@ int jbmp_read_bmp_file(char* fname, jbmp_bitmap_t* bitmap, int verbose)
   // (we don't care about palette stuff -- life in truecolor, baby!)
   f = fopen(fname, "r");
   fseek(f, header.bitmap_offset, SEEK_SET);
-  int a = jbmp_read_file_bitmap(f, header, bitmap, 1);
+  jbmp_hash_init(&hs, bitmap->width, bitmap->height);
+  int a = jbmp_read_rows(f, header, bitmap, (hash != NULL) ? &hs : NULL,
+                         verbose);
 
   if (a != bitmap->size_bytes)
   {
@@ -196,6 +215,8 @@ int jbmp_read_bmp_file(char* fname, jbmp_bitmap_t* bitmap, int verbose)
     return JBMP_ERR_SIZE_MISMATCH;
   }
 
+  if (hash != NULL) *hash = jbmp_hash_final(&hs);
+
   fp = ftell(f);
   fclose(f);
 
@@ -242,7 +263,10 @@ int jbmp_write_file_header(FILE* f, jbmp_header_t h, int verbose)
   //return fwrite(h, sizeof(jbmp_header_t), 1, f);
 }
 
-int jbmp_write_file_bitmap(FILE* f, jbmp_bitmap_t* b, int verbose)
+// writes the rows of the bitmap; if 'hs' is not NULL each row is added to the
+// content hash as it is encoded.
+static int jbmp_write_rows(FILE* f, jbmp_bitmap_t* b, jbmp_hash_state_t* hs,
+                           int verbose)
 {
   int a = 0;
   int j, k, n;
@@ -271,6 +295,8 @@ int jbmp_write_file_bitmap(FILE* f, jbmp_bitmap_t* b, int verbose)
       a++;
     }
     
+    if (hs != NULL) jbmp_hash_row(hs, j, &b->bitmap[j * b->width]);
+    
     if (verbose > 0 && line % verbose == 0)
     {
       printf("\rwriting line %i / %i", line, b->height-1);
@@ -278,11 +304,16 @@ int jbmp_write_file_bitmap(FILE* f, jbmp_bitmap_t* b, int verbose)
     
     line++;
   }
-  printf("... done. \n\n");
+  if (verbose > 0) printf("... done. \n\n");
   return a;
 }
 
-int jbmp_init_header(jbmp_header_t* h, jbmp_bitmap_t* b)
+int jbmp_write_file_bitmap(FILE* f, jbmp_bitmap_t* b, int verbose)
+{
+  return jbmp_write_rows(f, b, NULL, verbose);
+}
+
+int jbmp_init_header(jbmp_header_t* h, const jbmp_bitmap_t* b)
 {
   int row_size_bytes = (((b->width*3)+3)/4) * 4;
   //h->magic = JBMP_MAGIC_NUMBER;
@@ -309,8 +340,15 @@ int jbmp_init_header(jbmp_header_t* h, jbmp_bitmap_t* b)
 
 
 int jbmp_write_bmp_file(char* fname, jbmp_bitmap_t* bitmap, int verbose)
+{
+  return jbmp_write_bmp_file_hash(fname, bitmap, NULL, verbose);
+}
+
+int jbmp_write_bmp_file_hash(char* fname, jbmp_bitmap_t* bitmap, uint64_t* hash,
+                             int verbose)
 {
   jbmp_header_t header;
+  jbmp_hash_state_t hs;
   FILE* f;
   jbmp_init_header(&header, bitmap);
   
@@ -328,18 +366,144 @@ int jbmp_write_bmp_file(char* fname, jbmp_bitmap_t* bitmap, int verbose)
   
   if (f == NULL)
   {
-    printf("BMP write err: cannot open '%s' for writing.\n", fname);
+    if (verbose>0)
+    {
+      printf("BMP write err: cannot open '%s' for writing.\n", fname);
+    }
     return JBMP_ERR_BAD_FILENAME;
   }
   
   if (verbose>0) printf("opened %s for writing.\n", fname);
   
-  jbmp_write_file_header(f, header, 1);
+  jbmp_write_file_header(f, header, verbose);
   
   fseek(f, header.bitmap_offset, SEEK_SET);
-  jbmp_write_file_bitmap(f, bitmap, 1);
+  jbmp_hash_init(&hs, bitmap->width, bitmap->height);
+  jbmp_write_rows(f, bitmap, (hash != NULL) ? &hs : NULL, verbose);
+  if (hash != NULL) *hash = jbmp_hash_final(&hs);
   
+  int fp = (int)ftell(f);
   fclose(f);
+  
+  return fp;
+}
+
+int jbmp_update_bmp_file(char* fname, jbmp_bitmap_t* bitmap, int verbose)
+{
+  jbmp_header_t header;
+  FILE* f;
+  int y, c;
+  int a = 0;
+  
+  memset(&header, 0, sizeof(jbmp_header_t));
+  
+  // nothing tells us which rows changed, so write everything
+  if (bitmap->dirty_rows == NULL)
+  {
+    return jbmp_write_bmp_file(fname, bitmap, verbose);
+  }
+  
+  f = fopen(fname, "r+");
+  if (f == NULL)
+  {
+    if (verbose>0) printf("BMP update err: cannot open '%s'.\n", fname);
+    return JBMP_ERR_BAD_FILENAME;
+  }
+  
+  c = jbmp_read_file_header(f, &header, 0);
+  
+  // the file has to be laid out exactly the way we'd write it ourselves,
+  // starting with a complete header (34 bytes, or 26 for the old core one)
+  if (c < ((header.size_of_header >= 40) ? 34 : 26))
+  {
+    if (verbose>0) printf("BMP update err: header is truncated.\n");
+    fclose(f);
+    return JBMP_ERR_SIZE_MISMATCH;
+  }
+  else if (header.magic[0] != 'B' || header.magic[1] != 'M')
+  {
+    if (verbose>0)
+    {
+      printf("BMP update err: bad magic number '%c%c'\n", 
+             header.magic[0], header.magic[1]);
+    }
+    fclose(f);
+    return JBMP_ERR_BAD_MAGIC;
+  }
+  else if (header.bpp != 24 || 
+           (header.size_of_header >= 40 && header.comp_method != 0))
+  {
+    if (verbose>0) printf("BMP update err: file is not uncompressed 24bpp.\n");
+    fclose(f);
+    return JBMP_ERR_BAD_FORMAT;
+  }
+  else if ((uint64_t)header.bitmap_offset <
+           14 + (uint64_t)header.size_of_header)
+  {
+    // the rows would land on top of the header
+    if (verbose>0)
+    {
+      printf("BMP update err: bitmap offset %u is inside the header.\n",
+             header.bitmap_offset);
+    }
+    fclose(f);
+    return JBMP_ERR_BAD_FORMAT;
+  }
+  else if (header.width != (uint32_t)bitmap->width ||
+           header.height != (uint32_t)bitmap->height)
+  {
+    if (verbose>0)
+    {
+      printf("BMP update err: file is %ix%i, bitmap is %ix%i.\n",
+             header.width, header.height, bitmap->width, bitmap->height);
+    }
+    fclose(f);
+    return JBMP_ERR_SIZE_MISMATCH;
+  }
+  
+  int row_size_bytes = (((bitmap->width*3)+3)/4) * 4;
+  long end_of_bitmap = (long)header.bitmap_offset +
+                       ((long)row_size_bytes * bitmap->height);
+  
+  fseek(f, 0, SEEK_END);
+  if (ftell(f) < end_of_bitmap)
+  {
+    if (verbose>0) printf("BMP update err: file is truncated.\n");
+    fclose(f);
+    return JBMP_ERR_SIZE_MISMATCH;
+  }
+  
+  // bmp files store rows from the bottom to top, so row 'y' of the bitmap
+  // is row (height-1-y) of the file. the row padding is already in the file,
+  // so only the pixels are written.
+  for (y = 0; y < bitmap->height; y++)
+  {
+    if (!jbmp_row_is_dirty(bitmap, y)) continue;
+    
+    long pos = (long)header.bitmap_offset +
+               ((long)row_size_bytes * (bitmap->height-1-y));
+    
+    if (fseek(f, pos, SEEK_SET) != 0 ||
+        fwrite(&bitmap->bitmap[y * bitmap->width], sizeof(jbmp_pixel_t),
+               bitmap->width, f) != (size_t)bitmap->width)
+    {
+      if (verbose>0) printf("BMP update err: write failed at row %i.\n", y);
+      fclose(f);
+      return JBMP_ERR_IO;
+    }
+    a += bitmap->width * sizeof(jbmp_pixel_t);
+  }
+  
+  if (fclose(f) != 0)
+  {
+    if (verbose>0) printf("BMP update err: write failed.\n");
+    return JBMP_ERR_IO;
+  }
+  
+  if (verbose>0) printf("BMP update: wrote %i bytes to '%s'.\n", a, fname);
+  
+  jbmp_clear_dirty_rows(bitmap);
+  return a;
 }
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
@@ -359,16 +523,30 @@ int jbmp_init_bitmap(jbmp_bitmap_t* b, int w, int h, char* fname)
   b->size = (uint32_t)(w*h);
   b->size_bytes = (b->size * sizeof(jbmp_pixel_t));
   
+  b->filename = NULL;
+  b->dirty_rows = NULL;
+  
   b->bitmap = calloc(b->size, sizeof(jbmp_pixel_t));
   if (b->bitmap == NULL) return JBMP_ERR_NOMEM;
-  else return b->size_bytes;
   
-  // if (fname != NULL)
-  // {
+  if (fname != NULL)
+  {
     int len = (int)strlen(fname)+1;
     b->filename = malloc(len);
-    strncpy(b->filename, fname, len);
-  //}
+    if (b->filename != NULL) strncpy(b->filename, fname, len);
+  }
+  
+  return b->size_bytes;
+}
+
+void jbmp_free_bitmap(jbmp_bitmap_t* b)
+{
+  free(b->bitmap);
+  free(b->filename);
+  free(b->dirty_rows);
+  b->bitmap = NULL;
+  b->filename = NULL;
+  b->dirty_rows = NULL;
 }
 
 int p_offset(int w, int x, int y)
@@ -394,9 +572,59 @@ int jbmp_set_pixel(jbmp_bitmap_t* b, int x, int y, jbmp_pixel_t p)
   else if (y >= b->height) y = b->height-1;
   
   b->bitmap[p_offset(b->width, x, y)] = p;
+  if (b->dirty_rows != NULL) b->dirty_rows[y >> 3] |= (1 << (y & 7));
   return 1;
 }
 
+int jbmp_track_dirty_rows(jbmp_bitmap_t* b, bool enable)
+{
+  int len = (b->height+7)/8;
+  
+  if (!enable)
+  {
+    free(b->dirty_rows);
+    b->dirty_rows = NULL;
+    return 0;
+  }
+  
+  if (b->dirty_rows == NULL)
+  {
+    b->dirty_rows = calloc(len, 1);
+    if (b->dirty_rows == NULL) return JBMP_ERR_NOMEM;
+  }
+  else
+  {
+    memset(b->dirty_rows, 0, len);
+  }
+  return len;
+}
+
+void jbmp_mark_dirty_rows(jbmp_bitmap_t* b, int y0, int y1)
+{
+  int y;
+  
+  if (b->dirty_rows == NULL) return;
+  if (y0 < 0) y0 = 0;
+  if (y1 > b->height) y1 = b->height;
+  
+  for (y = y0; y < y1; y++)
+  {
+    b->dirty_rows[y >> 3] |= (1 << (y & 7));
+  }
+}
+
+void jbmp_clear_dirty_rows(jbmp_bitmap_t* b)
+{
+  if (b->dirty_rows == NULL) return;
+  memset(b->dirty_rows, 0, (b->height+7)/8);
+}
+
+bool jbmp_row_is_dirty(jbmp_bitmap_t* b, int y)
+{
+  if (b->dirty_rows == NULL || y < 0 || y >= b->height) return false;
+  return (b->dirty_rows[y >> 3] >> (y & 7)) & 1;
+}
+
 int jbmp_set_pixel_channel(jbmp_pixel_t* p, jbmp_rgb_t channel, int v)
 {
   switch (channel)
@@ -437,3 +665,114 @@ int jbmp_get_pixel_channel(jbmp_pixel_t p, jbmp_rgb_t channel)
   
   return (int)a;
 }
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                              CONTENT HASHING                              *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// the row hash is a small xxhash64-style function: four independent 64-bit
+// lanes eat 32 bytes per step (which the compiler can keep in registers or
+// vectorize), then the remaining 8-byte words and single bytes are folded in.
+
+#define JBMP_HASH_P1                    0x9E3779B185EBCA87ULL
+#define JBMP_HASH_P2                    0xC2B2AE3D27D4EB4FULL
+#define JBMP_HASH_P3                    0x165667B19E3779F9ULL
+#define JBMP_HASH_P4                    0x85EBCA77C2B2AE63ULL
+
+static uint64_t jbmp_hash_rotl(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+// reads 8 bytes as a little-endian word, so the hash of a given image is the
+// same on every machine.
+static uint64_t jbmp_hash_read64(const uint8_t* p)
+{
+  return  (uint64_t)p[0]        | ((uint64_t)p[1] << 8)  |
+         ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+         ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+         ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static uint64_t jbmp_hash_lane(uint64_t v, uint64_t w)
+{
+  return jbmp_hash_rotl(v + (w * JBMP_HASH_P2), 31) * JBMP_HASH_P1;
+}
+
+static uint64_t jbmp_hash_avalanche(uint64_t h)
+{
+  h ^= h >> 33;
+  h *= JBMP_HASH_P2;
+  h ^= h >> 29;
+  h *= JBMP_HASH_P3;
+  h ^= h >> 32;
+  return h;
+}
+
+static uint64_t jbmp_hash_bytes(const uint8_t* p, size_t n, uint64_t seed)
+{
+  uint64_t v1 = seed + JBMP_HASH_P1 + JBMP_HASH_P2;
+  uint64_t v2 = seed + JBMP_HASH_P2;
+  uint64_t v3 = seed;
+  uint64_t v4 = seed - JBMP_HASH_P1;
+  uint64_t h;
+  size_t len = n;
+
+  for (; n >= 32; n -= 32, p += 32)
+  {
+    v1 = jbmp_hash_lane(v1, jbmp_hash_read64(p));
+    v2 = jbmp_hash_lane(v2, jbmp_hash_read64(p + 8));
+    v3 = jbmp_hash_lane(v3, jbmp_hash_read64(p + 16));
+    v4 = jbmp_hash_lane(v4, jbmp_hash_read64(p + 24));
+  }
+  h = jbmp_hash_rotl(v1, 1) + jbmp_hash_rotl(v2, 7) +
+      jbmp_hash_rotl(v3, 12) + jbmp_hash_rotl(v4, 18);
+  h += (uint64_t)len;
+
+  for (; n >= 8; n -= 8, p += 8)
+  {
+    h ^= jbmp_hash_lane(0, jbmp_hash_read64(p));
+    h = jbmp_hash_rotl(h, 27) * JBMP_HASH_P1 + JBMP_HASH_P4;
+  }
+  for (; n > 0; n--, p++)
+  {
+    h ^= (uint64_t)(*p) * JBMP_HASH_P3;
+    h = jbmp_hash_rotl(h, 11) * JBMP_HASH_P1;
+  }
+
+  return jbmp_hash_avalanche(h);
+}
+
+void jbmp_hash_init(jbmp_hash_state_t* s, int w, int h)
+{
+  s->acc = 0;
+  s->width = w;
+  s->height = h;
+}
+
+void jbmp_hash_row(jbmp_hash_state_t* s, int y, const jbmp_pixel_t* row)
+{
+  // jbmp_pixel_t is 3 packed bytes, so a row is exactly 3*width bytes
+  s->acc += jbmp_hash_bytes((const uint8_t*)row,
+                            (size_t)s->width * sizeof(jbmp_pixel_t),
+                            (uint64_t)y);
+}
+
+uint64_t jbmp_hash_final(jbmp_hash_state_t* s)
+{
+  uint64_t dims = ((uint64_t)(uint32_t)s->width << 32) | (uint32_t)s->height;
+  return jbmp_hash_avalanche(s->acc ^ (dims * JBMP_HASH_P1));
+}
+
+uint64_t jbmp_hash_bitmap(const jbmp_bitmap_t* b)
+{
+  jbmp_hash_state_t hs;
+  int y;
+
+  jbmp_hash_init(&hs, b->width, b->height);
+  for (y = 0; y < b->height; y++)
+  {
+    jbmp_hash_row(&hs, y, &b->bitmap[y * b->width]);
+  }
+  return jbmp_hash_final(&hs);
+}
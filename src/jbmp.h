@@ -9,10 +9,15 @@
 #ifndef JBMP_H
 #define JBMP_H
 
+#include <stdio.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include "jbmp_types.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define JBMP_DEBUG                       1
 
 #define JBMP_ERR_BAD_FILENAME           -1
@@ -21,6 +26,7 @@
 #define JBMP_ERR_SIZE_MISMATCH          -4
 #define JBMP_ERR_BITMAP_TOO_BIG         -5
 #define JBMP_ERR_NOMEM                  -6
+#define JBMP_ERR_IO                     -7
 
 #define JBMP_MAGIC_NUMBER               "BM"
  
@@ -85,6 +91,25 @@ the main read function for reading BMP files; does the following:
 int jbmp_read_bmp_file(char* fname, jbmp_bitmap_t* bitmap, int verbose);
 
 
+/* * * jbmp_read_bmp_file_hash() * * * * * * * * * * * * * * * * * * * * * * *
+
+same as jbmp_read_bmp_file(), but also computes the content hash of the
+pixel data (see jbmp_hash_bitmap()) one row at a time as the rows are
+decoded, so no second pass over the bitmap is needed.
+
+ char* fname --------------- the string containing the file name.
+ jbmp_bitmap_t* bitmap ----- pointer to the bitmap struct where we put the 
+                               bitmap data from the file.
+ uint64_t* hash ------------ where the content hash is stored; may be NULL.
+ int verbose --------------- verbosity flag (0 = silent, >=1 = loud).
+ 
+ returns (int) ------------- the number of bytes read
+ 
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int jbmp_read_bmp_file_hash(char* fname, jbmp_bitmap_t* bitmap, uint64_t* hash,
+                            int verbose);
+
+
 /* * * jbmp_write_file_header()  * * * * * * * * * * * * * * * * * * * * * * *
 
 writes the header data from 'h' to file 'f'
@@ -127,7 +152,7 @@ int jbmp_write_file_bitmap(FILE* f, jbmp_bitmap_t* b, int verbose);
  returns (int) ------------ =1 on success.
  
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-int jbmp_init_header(jbmp_header_t* h, jbmp_bitmap_t* b);
+int jbmp_init_header(jbmp_header_t* h, const jbmp_bitmap_t* b);
 
 
 /* * * jbmp_read_file_bitmap() * * * * * * * * * * * * * * * * * * * * * * * *
@@ -148,6 +173,52 @@ the main read function for reading BMP files; does the following:
 int jbmp_write_bmp_file(char* fname, jbmp_bitmap_t* bitmap, int verbose);
 
 
+/* * * jbmp_write_bmp_file_hash()  * * * * * * * * * * * * * * * * * * * * * *
+
+same as jbmp_write_bmp_file(), but also computes the content hash of the
+pixel data (see jbmp_hash_bitmap()) one row at a time as the rows are
+encoded.
+
+ char* fname --------------- the string containing the file name.
+ jbmp_bitmap_t* bitmap ----- pointer to the bitmap struct where we get the
+                               bitmap data to write into the file.
+ uint64_t* hash ------------ where the content hash is stored; may be NULL.
+ int verbose --------------- verbosity flag (0 = silent, >=1 = loud).
+ 
+ returns (int) ------------- the number of bytes written.
+ 
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int jbmp_write_bmp_file_hash(char* fname, jbmp_bitmap_t* bitmap, uint64_t* hash,
+                             int verbose);
+
+
+/* * * jbmp_update_bmp_file()  * * * * * * * * * * * * * * * * * * * * * * * *
+
+saves 'bitmap' over an existing file 'fname' by writing back only the rows
+marked dirty (see jbmp_track_dirty_rows()), so the cost is proportional to
+the area that changed. does the following:
+  1. opens the file for update and reads its header.
+  2. checks that it is a 24bpp BMP with the same dimensions as 'bitmap' and
+     that it is long enough to hold all the rows.
+  3. writes each dirty row at its offset in the file, leaving the header and
+     row padding alone, and clears the dirty bits.
+
+if 'bitmap' is not tracking dirty rows, the whole file is rewritten with
+jbmp_write_bmp_file() instead.
+ 
+ char* fname --------------- the string containing the file name.
+ jbmp_bitmap_t* bitmap ----- pointer to the bitmap struct where we get the
+                               bitmap data to write into the file.
+ int verbose --------------- verbosity flag (0 = silent, >=1 = loud).
+ 
+ returns (int):
+   on failure: an error code
+   on success: the number of pixel bytes written
+ 
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int jbmp_update_bmp_file(char* fname, jbmp_bitmap_t* bitmap, int verbose);
+
+
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * ======================== BITMAP & PIXEL HANDLING ======================== *
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
@@ -160,6 +231,12 @@ bytes read.
 ******************************************************************************/
 int jbmp_init_bitmap(jbmp_bitmap_t* b, int w, int h, char* fname);
 
+/***** jbmp_free_bitmap() ****************************************************
+frees the pixel data, filename and dirty-row bitset of a bitmap set up by
+jbmp_init_bitmap() or jbmp_read_bmp_file(). the struct itself is not freed.
+******************************************************************************/
+void jbmp_free_bitmap(jbmp_bitmap_t* b);
+
 /***** jbmp_get_pixel ********************************************************
 returns the pixel in 'b' at location given by 'x' and 'y'
 ******************************************************************************/
@@ -170,6 +247,33 @@ sets the value of the pixel in 'b' at location given by 'x' and 'y'
 ******************************************************************************/
 int jbmp_set_pixel(jbmp_bitmap_t* b, int x, int y, jbmp_pixel_t p);
 
+/***** jbmp_track_dirty_rows() **********************************************
+turns dirty-row tracking on or off for 'b'. while it is on, every row touched
+by jbmp_set_pixel() or jbmp_mark_dirty_rows() is remembered until the next
+successful jbmp_update_bmp_file() -- nothing else clears the bits, so saving
+a copy with jbmp_write_bmp_file() or jbmp_write_fd() doesn't lose the edits
+still to be written back. turning it on starts with all rows clean; returns
+the size of the row bitset, or JBMP_ERR_NOMEM.
+******************************************************************************/
+int jbmp_track_dirty_rows(jbmp_bitmap_t* b, bool enable);
+
+/***** jbmp_mark_dirty_rows() ************************************************
+marks rows 'y0' up to (not including) 'y1' as dirty. call this after writing
+to b->bitmap directly; it does nothing if 'b' is not tracking dirty rows.
+******************************************************************************/
+void jbmp_mark_dirty_rows(jbmp_bitmap_t* b, int y0, int y1);
+
+/***** jbmp_clear_dirty_rows() ***********************************************
+marks every row of 'b' as clean.
+******************************************************************************/
+void jbmp_clear_dirty_rows(jbmp_bitmap_t* b);
+
+/***** jbmp_row_is_dirty() ***************************************************
+returns true if row 'y' of 'b' has changed since it was last saved; always
+false if 'b' is not tracking dirty rows.
+******************************************************************************/
+bool jbmp_row_is_dirty(jbmp_bitmap_t* b, int y);
+
 // 'v' is cast to type uint8_t
 int jbmp_set_pixel_channel(jbmp_pixel_t* p, jbmp_rgb_t channel, int v);
 
@@ -177,7 +281,45 @@ int jbmp_set_pixel_channel(jbmp_pixel_t* p, jbmp_rgb_t channel, int v);
 int jbmp_get_pixel_channel(jbmp_pixel_t p, jbmp_rgb_t channel);
 
 
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * ============================ CONTENT HASHING ============================ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// the content hash is a fast, non-cryptographic 64-bit hash of the pixel data
+// and the dimensions of a bitmap. it is meant for dedup and cache keys, not
+// for security. each row is hashed on its own (seeded with its row number)
+// and the row hashes are summed, so the rows can be fed in any order -- this
+// lets the file reader hash bottom-to-top as it decodes. BMP row padding is
+// never hashed, so a bitmap hashes the same whether it came from a file or
+// was drawn in memory.
+
+/***** jbmp_hash_init() ******************************************************
+starts a new content hash for a bitmap of 'w' x 'h' pixels.
+******************************************************************************/
+void jbmp_hash_init(jbmp_hash_state_t* s, int w, int h);
+
+/***** jbmp_hash_row() *******************************************************
+adds row 'y' to the hash; 'row' points to the first of the 'w' pixels of that
+row. each row must be added exactly once.
+******************************************************************************/
+void jbmp_hash_row(jbmp_hash_state_t* s, int y, const jbmp_pixel_t* row);
+
+/***** jbmp_hash_final() *****************************************************
+returns the content hash once all rows have been added.
+******************************************************************************/
+uint64_t jbmp_hash_final(jbmp_hash_state_t* s);
+
+/***** jbmp_hash_bitmap() ****************************************************
+returns the content hash of all the pixels in 'b'.
+******************************************************************************/
+uint64_t jbmp_hash_bitmap(const jbmp_bitmap_t* b);
+
+
+
 
 
+#ifdef __cplusplus
+}
+#endif
 
 #endif // JBMP_H
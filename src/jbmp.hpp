@@ -0,0 +1,521 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *    jbmp.hpp: header-only C++ layer over the jbmp library.                 *
+ *                                                                           *
+ *    https://github.com/johngineer/jbmp                                     *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// everything here is templates and inline functions over jbmp_bitmap_t, so
+// pixel loops compile down to pointer arithmetic on the bitmap memory with
+// no calls across the C boundary. the C struct is always reachable through
+// Bitmap::c_struct(), and the file functions of jbmp.h / jbmp_fd.h are
+// wrapped as members that return the same ints (bytes or JBMP_ERR_*).
+//
+// requires C++11.
+
+#ifndef JBMP_HPP
+#define JBMP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <utility>
+#include "jbmp.h"
+#include "jbmp_fd.h"
+
+namespace jbmp
+{
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * ============================ PIXEL FORMATS ============================== *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// a pixel format is a traits struct with:
+//
+//   pixel_type ------------ the in-memory pixel.
+//   bytes_per_pixel ------- sizeof(pixel_type); rows are never padded.
+//   fill() ---------------- sets 'n' pixels starting at 'p' to 'v'.
+//
+// the algorithms below take the format as a template parameter, so anything
+// format-specific is chosen at compile time. the C library only handles
+// 24bpp RGB, so BGR24 is the only format that can be read or written.
+
+// 24bpp, stored blue, green, red -- the same as jbmp_pixel_t and .BMP files
+struct BGR24
+{
+  typedef jbmp_pixel_t pixel_type;
+
+  static constexpr std::size_t bytes_per_pixel = 3;
+
+  static void fill(pixel_type* p, std::size_t n, const pixel_type& v)
+  {
+    // grey (including black and white) is the same byte three times over
+    if (v.b == v.g && v.g == v.r)
+    {
+      std::memset(p, v.b, n * bytes_per_pixel);
+      return;
+    }
+    for (pixel_type* end = p + n; p != end; ++p) *p = v;
+  }
+};
+
+static_assert(sizeof(BGR24::pixel_type) == BGR24::bytes_per_pixel,
+              "jbmp_pixel_t must be 3 packed bytes");
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * =========================== CHANNEL ACCESS ============================== *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// the channel is a template argument, so these are a plain member access
+// instead of the switch in jbmp_get_pixel_channel().
+
+template <jbmp_rgb_t C> struct channel_traits;
+
+template <> struct channel_traits<blue>
+{
+  static constexpr std::size_t offset = 0;
+  static constexpr uint8_t get(const jbmp_pixel_t& p) { return p.b; }
+  static uint8_t& ref(jbmp_pixel_t& p) { return p.b; }
+};
+
+template <> struct channel_traits<green>
+{
+  static constexpr std::size_t offset = 1;
+  static constexpr uint8_t get(const jbmp_pixel_t& p) { return p.g; }
+  static uint8_t& ref(jbmp_pixel_t& p) { return p.g; }
+};
+
+template <> struct channel_traits<red>
+{
+  static constexpr std::size_t offset = 2;
+  static constexpr uint8_t get(const jbmp_pixel_t& p) { return p.r; }
+  static uint8_t& ref(jbmp_pixel_t& p) { return p.r; }
+};
+
+// e.g. jbmp::channel<red>(p)
+template <jbmp_rgb_t C>
+constexpr uint8_t channel(const jbmp_pixel_t& p)
+{
+  return channel_traits<C>::get(p);
+}
+
+template <jbmp_rgb_t C>
+inline uint8_t& channel(jbmp_pixel_t& p)
+{
+  return channel_traits<C>::ref(p);
+}
+
+// builds a pixel from its channels in r, g, b order
+constexpr jbmp_pixel_t pixel(uint8_t r, uint8_t g, uint8_t b)
+{
+  return jbmp_pixel_t{ b, g, r };
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * ============================= ROW ITERATION ============================= *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// one row of pixels; begin()/end() are raw pointers.
+template <class P>
+class Row
+{
+public:
+  Row(P* first, int width) : first_(first), width_(width) {}
+
+  P* begin() const { return first_; }
+  P* end() const { return first_ + width_; }
+  int size() const { return width_; }
+  P& operator[](int x) const { return first_[x]; }
+
+private:
+  P* first_;
+  int width_;
+};
+
+// steps through the rows of a bitmap, top to bottom.
+template <class P>
+class RowIterator
+{
+public:
+  RowIterator(P* first, int width) : p_(first), width_(width) {}
+
+  Row<P> operator*() const { return Row<P>(p_, width_); }
+  RowIterator& operator++() { p_ += width_; return *this; }
+  RowIterator operator++(int) { RowIterator t(*this); p_ += width_; return t; }
+  bool operator==(const RowIterator& o) const { return p_ == o.p_; }
+  bool operator!=(const RowIterator& o) const { return p_ != o.p_; }
+
+private:
+  P* p_;
+  int width_;
+};
+
+template <class P>
+class RowRange
+{
+public:
+  RowRange(P* first, int width, int height)
+    : first_(first), width_(width), height_(height) {}
+
+  RowIterator<P> begin() const { return RowIterator<P>(first_, width_); }
+  RowIterator<P> end() const
+  {
+    return RowIterator<P>(first_ + (std::ptrdiff_t)width_ * height_, width_);
+  }
+
+private:
+  P* first_;
+  int width_;
+  int height_;
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * ================================ BITMAP ================================= *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// a read-only view of a jbmp_bitmap_t that somebody else owns, such as a
+// handle from jbmp_cache_acquire(); only const accessors are offered, so it
+// can't be used to write into a shared bitmap. 'b' must outlive the view.
+// copyable, since it owns nothing.
+template <class Format = BGR24>
+class ConstView
+{
+public:
+  typedef Format format_type;
+  typedef typename Format::pixel_type pixel_type;
+  typedef const pixel_type* const_iterator;
+
+  explicit ConstView(const jbmp_bitmap_t& b) : b_(&b) {}
+
+  const jbmp_bitmap_t* c_struct() const { return b_; }
+
+  bool empty() const { return b_->bitmap == nullptr; }
+  int width() const { return b_->width; }
+  int height() const { return b_->height; }
+  int size() const { return b_->size; }
+
+  const pixel_type* data() const { return b_->bitmap; }
+  const_iterator begin() const { return b_->bitmap; }
+  const_iterator end() const { return b_->bitmap + b_->size; }
+
+  Row<const pixel_type> row(int y) const
+  {
+    return Row<const pixel_type>(b_->bitmap + (std::ptrdiff_t)y * b_->width,
+                                 b_->width);
+  }
+
+  RowRange<const pixel_type> rows() const
+  {
+    return RowRange<const pixel_type>(b_->bitmap, b_->width, b_->height);
+  }
+
+  const pixel_type& operator()(int x, int y) const
+  {
+    return b_->bitmap[(std::ptrdiff_t)y * b_->width + x];
+  }
+
+  uint64_t hash() const { return jbmp_hash_bitmap(b_); }
+
+  // jbmp_write_bmp_file() doesn't write to the bitmap; it just isn't const
+  int write(const char* fname, int verbose = 0) const
+  {
+    return jbmp_write_bmp_file(const_cast<char*>(fname),
+                               const_cast<jbmp_bitmap_t*>(b_), verbose);
+  }
+
+  int write_fd(int fd, int verbose = 0) const
+  {
+    return jbmp_write_fd(fd, b_, verbose);
+  }
+
+private:
+  static_assert(sizeof(pixel_type) == sizeof(jbmp_pixel_t),
+                "jbmp_bitmap_t can only hold 24bpp pixels");
+
+  const jbmp_bitmap_t* b_;
+};
+
+// a bitmap that either owns its jbmp_bitmap_t (freed with jbmp_free_bitmap()
+// when it goes out of scope) or is a writable view of one that somebody else
+// owns. a view points at the caller's struct, so everything done through it
+// -- dirty tracking, reading, updating -- happens to that struct. for bitmaps
+// that must not be written, use ConstView. move-only.
+template <class Format = BGR24>
+class Bitmap
+{
+public:
+  typedef Format format_type;
+  typedef typename Format::pixel_type pixel_type;
+  typedef pixel_type* iterator;
+  typedef const pixel_type* const_iterator;
+
+  // an empty bitmap
+  Bitmap() { clear(); }
+
+  // an owned, zeroed 'w' x 'h' bitmap; throws std::bad_alloc if out of memory
+  Bitmap(int w, int h, const char* fname = nullptr) : b_(&own_), owns_(true)
+  {
+    if (jbmp_init_bitmap(&own_, w, h, const_cast<char*>(fname)) < 0)
+    {
+      jbmp_free_bitmap(&own_);
+      throw std::bad_alloc();
+    }
+  }
+
+  // a writable view of 'b'; 'b' must outlive it
+  static Bitmap view(jbmp_bitmap_t& b) { return Bitmap(&b); }
+
+  // a read-only view of this bitmap
+  ConstView<Format> cview() const { return ConstView<Format>(*b_); }
+
+  // takes ownership of 'b', e.g. after jbmp_read_bmp_file(); 'b' is emptied
+  static Bitmap adopt(jbmp_bitmap_t& b)
+  {
+    Bitmap r;
+    r.own_ = b;
+    r.owns_ = true;
+    b.bitmap = nullptr;
+    b.filename = nullptr;
+    b.dirty_rows = nullptr;
+    return r;
+  }
+
+  Bitmap(Bitmap&& o) noexcept { take(o); }
+
+  Bitmap& operator=(Bitmap&& o) noexcept
+  {
+    if (this != &o)
+    {
+      reset();
+      take(o);
+    }
+    return *this;
+  }
+
+  Bitmap(const Bitmap&) = delete;
+  Bitmap& operator=(const Bitmap&) = delete;
+
+  ~Bitmap() { reset(); }
+
+  // gives up ownership (or detaches a view) and returns the C struct; the
+  // caller frees it
+  jbmp_bitmap_t release()
+  {
+    jbmp_bitmap_t b = *b_;
+    clear();
+    return b;
+  }
+
+  jbmp_bitmap_t* c_struct() { return b_; }
+  const jbmp_bitmap_t* c_struct() const { return b_; }
+
+  bool owns() const { return owns_; }
+  bool empty() const { return b_->bitmap == nullptr; }
+  int width() const { return b_->width; }
+  int height() const { return b_->height; }
+  int size() const { return b_->size; }
+
+  pixel_type* data() { return b_->bitmap; }
+  const pixel_type* data() const { return b_->bitmap; }
+
+  // all pixels, top-left to bottom-right; rows are contiguous
+  iterator begin() { return b_->bitmap; }
+  iterator end() { return b_->bitmap + b_->size; }
+  const_iterator begin() const { return b_->bitmap; }
+  const_iterator end() const { return b_->bitmap + b_->size; }
+
+  Row<pixel_type> row(int y)
+  {
+    return Row<pixel_type>(b_->bitmap + (std::ptrdiff_t)y * b_->width,
+                           b_->width);
+  }
+  Row<const pixel_type> row(int y) const
+  {
+    return Row<const pixel_type>(b_->bitmap + (std::ptrdiff_t)y * b_->width,
+                                 b_->width);
+  }
+
+  RowRange<pixel_type> rows()
+  {
+    return RowRange<pixel_type>(b_->bitmap, b_->width, b_->height);
+  }
+  RowRange<const pixel_type> rows() const
+  {
+    return RowRange<const pixel_type>(b_->bitmap, b_->width, b_->height);
+  }
+
+  // unchecked, unlike jbmp_get_pixel(); writing through this does not mark
+  // the row dirty -- call mark_dirty() afterwards if tracking.
+  pixel_type& operator()(int x, int y)
+  {
+    return b_->bitmap[(std::ptrdiff_t)y * b_->width + x];
+  }
+  const pixel_type& operator()(int x, int y) const
+  {
+    return b_->bitmap[(std::ptrdiff_t)y * b_->width + x];
+  }
+
+  // dirty-row tracking, see jbmp_track_dirty_rows()
+  int track_dirty(bool enable) { return jbmp_track_dirty_rows(b_, enable); }
+  void mark_dirty(int y0, int y1) { jbmp_mark_dirty_rows(b_, y0, y1); }
+  void mark_dirty() { jbmp_mark_dirty_rows(b_, 0, b_->height); }
+
+  uint64_t hash() const { return jbmp_hash_bitmap(b_); }
+
+  // file I/O; these return what the C functions return. reading replaces
+  // the contents with the new image: an owned bitmap stays owned, and a view
+  // frees its struct's old contents with jbmp_free_bitmap() and reads into
+  // that struct. on failure nothing changes.
+  int read(const char* fname, int verbose = 0)
+  {
+    return read_with([&](jbmp_bitmap_t* b) {
+      return jbmp_read_bmp_file(const_cast<char*>(fname), b, verbose);
+    });
+  }
+
+  int read_fd(int fd, int verbose = 0)
+  {
+    return read_with([&](jbmp_bitmap_t* b) {
+      return jbmp_read_fd(fd, b, verbose);
+    });
+  }
+
+  int write(const char* fname, int verbose = 0)
+  {
+    return jbmp_write_bmp_file(const_cast<char*>(fname), b_, verbose);
+  }
+
+  int update(const char* fname, int verbose = 0)
+  {
+    return jbmp_update_bmp_file(const_cast<char*>(fname), b_, verbose);
+  }
+
+  int write_fd(int fd, int verbose = 0)
+  {
+    return jbmp_write_fd(fd, b_, verbose);
+  }
+
+private:
+  static_assert(sizeof(pixel_type) == sizeof(jbmp_pixel_t),
+                "jbmp_bitmap_t can only hold 24bpp pixels");
+
+  explicit Bitmap(jbmp_bitmap_t* b) : b_(b), owns_(false)
+  {
+    std::memset(&own_, 0, sizeof(own_));
+  }
+
+  bool is_view() const { return b_ != &own_; }
+
+  void clear()
+  {
+    std::memset(&own_, 0, sizeof(own_));
+    b_ = &own_;
+    owns_ = false;
+  }
+
+  void reset()
+  {
+    if (owns_) jbmp_free_bitmap(&own_);
+    clear();
+  }
+
+  // moves 'o' into this (empty) bitmap; a view keeps pointing at the same
+  // struct, an owned bitmap is re-pointed at our own copy.
+  void take(Bitmap& o)
+  {
+    own_ = o.own_;
+    b_ = o.is_view() ? o.b_ : &own_;
+    owns_ = o.owns_;
+    o.clear();
+  }
+
+  template <class Fn>
+  int read_with(Fn fn)
+  {
+    jbmp_bitmap_t b;
+    std::memset(&b, 0, sizeof(b));
+
+    int a = fn(&b);
+    if (a < 0)
+    {
+      jbmp_free_bitmap(&b);
+      return a;
+    }
+    if (is_view())
+    {
+      jbmp_free_bitmap(b_);
+      *b_ = b;
+      return a;
+    }
+    reset();
+    own_ = b;
+    owns_ = true;
+    return a;
+  }
+
+  jbmp_bitmap_t own_;   // the struct itself when owned; zeroed for a view
+  jbmp_bitmap_t* b_;    // &own_, or the caller's struct for a view
+  bool owns_;
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * ============================== ALGORITHMS ================================ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// the ones that write mark every row dirty, so jbmp_update_bmp_file() still
+// knows what to save.
+
+// sets every pixel to 'v'
+template <class F>
+void fill(Bitmap<F>& b, const typename F::pixel_type& v)
+{
+  F::fill(b.data(), (std::size_t)b.size(), v);
+  b.mark_dirty();
+}
+
+// sets the rectangle at 'x0','y0' of 'w' x 'h' pixels to 'v', clipped to
+// the bitmap
+template <class F>
+void fill(Bitmap<F>& b, int x0, int y0, int w, int h,
+          const typename F::pixel_type& v)
+{
+  if (x0 < 0) { w += x0; x0 = 0; }
+  if (y0 < 0) { h += y0; y0 = 0; }
+  if (x0 + w > b.width()) w = b.width() - x0;
+  if (y0 + h > b.height()) h = b.height() - y0;
+  if (w <= 0 || h <= 0) return;
+
+  for (int y = y0; y < y0 + h; y++)
+  {
+    F::fill(&b(x0, y), (std::size_t)w, v);
+  }
+  b.mark_dirty(y0, y0 + h);
+}
+
+// replaces every pixel 'p' with fn(p)
+template <class F, class Fn>
+void transform(Bitmap<F>& b, Fn fn)
+{
+  for (typename F::pixel_type& p : b) p = fn(p);
+  b.mark_dirty();
+}
+
+// folds every pixel into 'acc' with acc = fn(acc, p), top-left first
+template <class F, class T, class Fn>
+T reduce(const ConstView<F>& b, T acc, Fn fn)
+{
+  for (const typename F::pixel_type& p : b) acc = fn(acc, p);
+  return acc;
+}
+
+template <class F, class T, class Fn>
+T reduce(const Bitmap<F>& b, T acc, Fn fn)
+{
+  return reduce(b.cview(), acc, fn);
+}
+
+} // namespace jbmp
+
+#endif // JBMP_HPP
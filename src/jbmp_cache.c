@@ -0,0 +1,432 @@
+// jbmp_cache.c
+
+/*
+jbmp_cache :: a decoded-image cache for the jbmp library
+
+each cached file is an entry, found through a small per-shard hash table and
+kept on a per-shard ring that the CLOCK hand sweeps when the cache is over
+its budget. the budget is shared by all shards: the total is a single counter
+updated with atomic adds, so any one entry can use all of it. handles given
+to callers point at the bitmap inside the entry, so releasing a handle never
+has to search for anything.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "jbmp.h"
+#include "jbmp_cache.h"
+
+typedef struct jbmp_cache_shard_t jbmp_cache_shard_t;
+
+typedef struct jbmp_cache_entry_t
+{
+  jbmp_bitmap_t bitmap;   // must come first: handles point here
+
+  // the key
+  char* path;
+  uint32_t path_hash;
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+
+  size_t bytes;           // what this entry counts against the budget
+  int refs;               // handles currently held by callers
+  int referenced;         // CLOCK bit, set on every hit
+  int cached;             // still linked into the shard
+  jbmp_cache_shard_t* shard;
+
+  struct jbmp_cache_entry_t* bucket_next;
+  struct jbmp_cache_entry_t* ring_prev;
+  struct jbmp_cache_entry_t* ring_next;
+
+} jbmp_cache_entry_t;
+
+struct jbmp_cache_shard_t
+{
+  pthread_mutex_t lock;
+  jbmp_cache_entry_t* buckets[JBMP_CACHE_BUCKETS];
+  jbmp_cache_entry_t* hand;   // CLOCK hand; NULL when the ring is empty
+  size_t entries;
+  struct jbmp_cache_t* cache;
+
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+  unsigned long invalidations;
+  unsigned long uncacheable;
+};
+
+struct jbmp_cache_t
+{
+  jbmp_cache_shard_t shards[JBMP_CACHE_SHARDS];
+  size_t budget;
+  size_t bytes;   // over all shards; only touched with __atomic builtins
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                  ENTRIES                                  *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// FNV-1a over the path string
+static uint32_t jbmp_cache_hash_path(const char* s)
+{
+  uint32_t h = 2166136261u;
+  while (*s)
+  {
+    h ^= (uint8_t)(*s++);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static int jbmp_cache_same_file(jbmp_cache_entry_t* e, struct stat* st)
+{
+  return e->dev == st->st_dev && e->ino == st->st_ino &&
+         e->size == st->st_size &&
+         e->mtime.tv_sec == st->st_mtim.tv_sec &&
+         e->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void jbmp_cache_free_entry(jbmp_cache_entry_t* e)
+{
+  jbmp_free_bitmap(&e->bitmap);
+  free(e->path);
+  free(e);
+}
+
+static jbmp_cache_entry_t** jbmp_cache_bucket(jbmp_cache_shard_t* s,
+                                              uint32_t path_hash)
+{
+  return &s->buckets[(path_hash / JBMP_CACHE_SHARDS) % JBMP_CACHE_BUCKETS];
+}
+
+static jbmp_cache_entry_t* jbmp_cache_find(jbmp_cache_shard_t* s,
+                                           const char* path, uint32_t h)
+{
+  jbmp_cache_entry_t* e = *jbmp_cache_bucket(s, h);
+
+  for (; e != NULL; e = e->bucket_next)
+  {
+    if (e->path_hash == h && strcmp(e->path, path) == 0) return e;
+  }
+  return NULL;
+}
+
+static void jbmp_cache_link(jbmp_cache_shard_t* s, jbmp_cache_entry_t* e)
+{
+  jbmp_cache_entry_t** bucket = jbmp_cache_bucket(s, e->path_hash);
+
+  e->bucket_next = *bucket;
+  *bucket = e;
+
+  // new entries go just behind the hand, so they are the last to be looked at
+  if (s->hand == NULL)
+  {
+    e->ring_prev = e;
+    e->ring_next = e;
+    s->hand = e;
+  }
+  else
+  {
+    e->ring_next = s->hand;
+    e->ring_prev = s->hand->ring_prev;
+    e->ring_prev->ring_next = e;
+    s->hand->ring_prev = e;
+  }
+
+  e->cached = 1;
+  __atomic_add_fetch(&s->cache->bytes, e->bytes, __ATOMIC_RELAXED);
+  s->entries++;
+}
+
+// takes 'e' out of the shard. the caller frees it if no handles are out;
+// otherwise the last jbmp_cache_release() does.
+static void jbmp_cache_unlink(jbmp_cache_shard_t* s, jbmp_cache_entry_t* e)
+{
+  jbmp_cache_entry_t** p = jbmp_cache_bucket(s, e->path_hash);
+
+  while (*p != e) p = &(*p)->bucket_next;
+  *p = e->bucket_next;
+
+  if (e->ring_next == e)
+  {
+    s->hand = NULL;
+  }
+  else
+  {
+    if (s->hand == e) s->hand = e->ring_next;
+    e->ring_prev->ring_next = e->ring_next;
+    e->ring_next->ring_prev = e->ring_prev;
+  }
+
+  e->cached = 0;
+  __atomic_sub_fetch(&s->cache->bytes, e->bytes, __ATOMIC_RELAXED);
+  s->entries--;
+}
+
+// true if 'need' more bytes fit in the budget of the whole cache
+static int jbmp_cache_fits(jbmp_cache_t* c, size_t need)
+{
+  return __atomic_load_n(&c->bytes, __ATOMIC_RELAXED) + need <= c->budget;
+}
+
+// runs the CLOCK hand of shard 's' until 'need' more bytes fit in the budget
+// of the cache, or the shard is empty. an entry whose bit is set gets a
+// second chance; every entry is looked at no more than twice, so this always
+// terminates.
+static void jbmp_cache_make_room(jbmp_cache_shard_t* s, size_t need)
+{
+  size_t steps = 2 * s->entries;
+
+  while (s->hand != NULL && !jbmp_cache_fits(s->cache, need) && steps-- > 0)
+  {
+    jbmp_cache_entry_t* e = s->hand;
+
+    if (e->referenced)
+    {
+      e->referenced = 0;
+      s->hand = e->ring_next;
+    }
+    else
+    {
+      jbmp_cache_unlink(s, e);
+      s->evictions++;
+      if (e->refs == 0) jbmp_cache_free_entry(e);
+    }
+  }
+}
+
+// looks up 'fname' in shard 's'. an entry for the same file is returned with
+// a new reference; an entry for an older version of the file is dropped.
+static jbmp_cache_entry_t* jbmp_cache_lookup(jbmp_cache_shard_t* s,
+                                             const char* fname, uint32_t h,
+                                             struct stat* st)
+{
+  jbmp_cache_entry_t* e = jbmp_cache_find(s, fname, h);
+
+  if (e == NULL) return NULL;
+
+  if (jbmp_cache_same_file(e, st))
+  {
+    e->refs++;
+    e->referenced = 1;
+    return e;
+  }
+
+  jbmp_cache_unlink(s, e);
+  s->invalidations++;
+  if (e->refs == 0) jbmp_cache_free_entry(e);
+  return NULL;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                 THE CACHE                                 *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+jbmp_cache_t* jbmp_cache_create(size_t budget_bytes)
+{
+  jbmp_cache_t* c = calloc(1, sizeof(jbmp_cache_t));
+  int i;
+
+  if (c == NULL) return NULL;
+
+  c->budget = budget_bytes;
+  for (i = 0; i < JBMP_CACHE_SHARDS; i++)
+  {
+    pthread_mutex_init(&c->shards[i].lock, NULL);
+    c->shards[i].cache = c;
+  }
+  return c;
+}
+
+void jbmp_cache_destroy(jbmp_cache_t* c)
+{
+  int i;
+
+  if (c == NULL) return;
+
+  for (i = 0; i < JBMP_CACHE_SHARDS; i++)
+  {
+    jbmp_cache_shard_t* s = &c->shards[i];
+
+    while (s->hand != NULL)
+    {
+      jbmp_cache_entry_t* e = s->hand;
+      jbmp_cache_unlink(s, e);
+      jbmp_cache_free_entry(e);
+    }
+    pthread_mutex_destroy(&s->lock);
+  }
+  free(c);
+}
+
+const jbmp_bitmap_t* jbmp_cache_acquire(jbmp_cache_t* c, char* fname,
+                                        int verbose, int* err)
+{
+  struct stat st;
+  uint32_t h;
+  jbmp_cache_shard_t* s;
+  jbmp_cache_entry_t* e;
+  jbmp_cache_entry_t* n;
+  int a, i;
+
+  if (stat(fname, &st) != 0)
+  {
+    if (verbose>0) printf("BMP cache err: cannot stat '%s'.\n", fname);
+    if (err != NULL) *err = JBMP_ERR_BAD_FILENAME;
+    return NULL;
+  }
+
+  h = jbmp_cache_hash_path(fname);
+  s = &c->shards[h % JBMP_CACHE_SHARDS];
+
+  // fast path: the file is cached and hasn't changed
+  pthread_mutex_lock(&s->lock);
+  e = jbmp_cache_lookup(s, fname, h, &st);
+  if (e != NULL)
+  {
+    s->hits++;
+    pthread_mutex_unlock(&s->lock);
+    return &e->bitmap;
+  }
+  s->misses++;
+  pthread_mutex_unlock(&s->lock);
+
+  // slow path: decode without holding the lock, so other files in this
+  // shard can still be served while we read.
+  n = calloc(1, sizeof(jbmp_cache_entry_t));
+  if (n == NULL)
+  {
+    if (err != NULL) *err = JBMP_ERR_NOMEM;
+    return NULL;
+  }
+  n->path = malloc(strlen(fname)+1);
+  if (n->path == NULL)
+  {
+    free(n);
+    if (err != NULL) *err = JBMP_ERR_NOMEM;
+    return NULL;
+  }
+  strcpy(n->path, fname);
+
+  a = jbmp_read_bmp_file(fname, &n->bitmap, verbose);
+  if (a < 0)
+  {
+    jbmp_cache_free_entry(n);
+    if (err != NULL) *err = a;
+    return NULL;
+  }
+
+  n->path_hash = h;
+  n->dev = st.st_dev;
+  n->ino = st.st_ino;
+  n->size = st.st_size;
+  n->mtime = st.st_mtim;
+  n->bytes = sizeof(jbmp_cache_entry_t) + strlen(fname)+1 +
+             (size_t)n->bitmap.size_bytes;
+  if (n->bitmap.filename != NULL) n->bytes += strlen(n->bitmap.filename)+1;
+  n->refs = 1;
+  n->referenced = 1;
+  n->shard = s;
+
+  pthread_mutex_lock(&s->lock);
+
+  // somebody else may have read the same file while we were at it
+  e = jbmp_cache_lookup(s, fname, h, &st);
+  if (e != NULL)
+  {
+    pthread_mutex_unlock(&s->lock);
+    jbmp_cache_free_entry(n);
+    return &e->bitmap;
+  }
+
+  // too big to ever fit: hand it out uncached, freed on release
+  if (n->bytes > c->budget)
+  {
+    s->uncacheable++;
+    pthread_mutex_unlock(&s->lock);
+    return &n->bitmap;
+  }
+
+  // evict from this shard first; if that isn't enough, go round the others.
+  // only one shard lock is ever held at a time, so this can't deadlock.
+  jbmp_cache_make_room(s, n->bytes);
+  if (!jbmp_cache_fits(c, n->bytes))
+  {
+    pthread_mutex_unlock(&s->lock);
+    for (i = 1; i < JBMP_CACHE_SHARDS && !jbmp_cache_fits(c, n->bytes); i++)
+    {
+      jbmp_cache_shard_t* o = &c->shards[(h + i) % JBMP_CACHE_SHARDS];
+      pthread_mutex_lock(&o->lock);
+      jbmp_cache_make_room(o, n->bytes);
+      pthread_mutex_unlock(&o->lock);
+    }
+    pthread_mutex_lock(&s->lock);
+
+    // the lock was dropped, so look again
+    e = jbmp_cache_lookup(s, fname, h, &st);
+    if (e != NULL)
+    {
+      pthread_mutex_unlock(&s->lock);
+      jbmp_cache_free_entry(n);
+      return &e->bitmap;
+    }
+  }
+
+  // threads inserting at the same moment can take the total a little over
+  // the budget; the next insert evicts it back down.
+  jbmp_cache_link(s, n);
+
+  pthread_mutex_unlock(&s->lock);
+  return &n->bitmap;
+}
+
+void jbmp_cache_release(jbmp_cache_t* c, const jbmp_bitmap_t* b)
+{
+  jbmp_cache_entry_t* e = (jbmp_cache_entry_t*)b;
+  jbmp_cache_shard_t* s;
+  int dead;
+
+  // the entry knows its own shard; 'c' is only taken to mirror acquire
+  (void)c;
+
+  if (b == NULL) return;
+
+  s = e->shard;
+  pthread_mutex_lock(&s->lock);
+  e->refs--;
+  dead = (e->refs == 0 && !e->cached);
+  pthread_mutex_unlock(&s->lock);
+
+  if (dead) jbmp_cache_free_entry(e);
+}
+
+void jbmp_cache_get_stats(jbmp_cache_t* c, jbmp_cache_stats_t* st)
+{
+  int i;
+
+  memset(st, 0, sizeof(jbmp_cache_stats_t));
+
+  for (i = 0; i < JBMP_CACHE_SHARDS; i++)
+  {
+    jbmp_cache_shard_t* s = &c->shards[i];
+
+    pthread_mutex_lock(&s->lock);
+    st->hits += s->hits;
+    st->misses += s->misses;
+    st->evictions += s->evictions;
+    st->invalidations += s->invalidations;
+    st->uncacheable += s->uncacheable;
+    st->entries += s->entries;
+    pthread_mutex_unlock(&s->lock);
+  }
+  st->bytes = __atomic_load_n(&c->bytes, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,122 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *    jbmp_cache: a decoded-image cache in front of jbmp_read_bmp_file().    *
+ *                                                                           *
+ *    https://github.com/johngineer/jbmp                                     *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef JBMP_CACHE_H
+#define JBMP_CACHE_H
+
+#include <stddef.h>
+#include "jbmp_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// the cache is split into this many shards, each with its own lock, so that
+// threads looking up different files rarely wait on each other.
+#define JBMP_CACHE_SHARDS               16
+
+// hash buckets per shard
+#define JBMP_CACHE_BUCKETS              64
+
+// the cache itself is opaque; use the functions below.
+typedef struct jbmp_cache_t jbmp_cache_t;
+
+// counters returned by jbmp_cache_get_stats(), summed over all shards.
+typedef struct jbmp_cache_stats_t
+{
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;      // entries dropped to stay under the budget
+  unsigned long invalidations;  // entries dropped because the file changed
+  unsigned long uncacheable;    // images read but too big for the budget
+  size_t bytes;                 // bytes currently held by cached entries
+  size_t entries;               // number of cached entries
+
+} jbmp_cache_stats_t;
+
+
+/* * * jbmp_cache_create() * * * * * * * * * * * * * * * * * * * * * * * * * *
+
+creates an empty cache that holds at most 'budget_bytes' of decoded images.
+the budget is shared by all the shards, so one image may use all of it; an
+image larger than the whole budget is decoded and handed out, but never kept
+(see 'uncacheable' in jbmp_cache_stats_t).
+
+ size_t budget_bytes ------- the memory budget in bytes.
+
+ returns (jbmp_cache_t*) --- the new cache, or NULL if out of memory.
+
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+jbmp_cache_t* jbmp_cache_create(size_t budget_bytes);
+
+
+/* * * jbmp_cache_destroy()  * * * * * * * * * * * * * * * * * * * * * * * * *
+
+frees the cache and every image in it. all handles returned by
+jbmp_cache_acquire() must have been released first.
+
+ jbmp_cache_t* c ----------- the cache.
+
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void jbmp_cache_destroy(jbmp_cache_t* c);
+
+
+/* * * jbmp_cache_acquire()  * * * * * * * * * * * * * * * * * * * * * * * * *
+
+returns a shared, read-only handle to the decoded contents of 'fname'. the
+file is stat()'ed on every call and an entry is only reused if the path,
+device, inode, mtime and size all match; otherwise the file is read with
+jbmp_read_bmp_file() and added to the cache, evicting the least recently
+used entries (CLOCK) as needed to stay within the budget -- first from its
+own shard, then from the others.
+
+every handle must be given back with jbmp_cache_release(). an entry that is
+evicted while handles to it are still out is freed on the last release.
+safe to call from several threads at once.
+
+ jbmp_cache_t* c ----------- the cache.
+ char* fname --------------- the string containing the file name.
+ int verbose --------------- verbosity flag, passed to jbmp_read_bmp_file()
+                               (0 = silent).
+ int* err ------------------ on failure, set to a JBMP_ERR_* code; may be
+                               NULL.
+
+ returns (const jbmp_bitmap_t*) -- the bitmap, or NULL on failure.
+
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+const jbmp_bitmap_t* jbmp_cache_acquire(jbmp_cache_t* c, char* fname,
+                                        int verbose, int* err);
+
+
+/* * * jbmp_cache_release()  * * * * * * * * * * * * * * * * * * * * * * * * *
+
+gives back a handle returned by jbmp_cache_acquire().
+
+ jbmp_cache_t* c ----------- the cache.
+ const jbmp_bitmap_t* b ---- the handle.
+
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void jbmp_cache_release(jbmp_cache_t* c, const jbmp_bitmap_t* b);
+
+
+/* * * jbmp_cache_get_stats()  * * * * * * * * * * * * * * * * * * * * * * * *
+
+fills 's' with the current counters of the cache.
+
+ jbmp_cache_t* c ----------- the cache.
+ jbmp_cache_stats_t* s ----- where the counters are stored.
+
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+void jbmp_cache_get_stats(jbmp_cache_t* c, jbmp_cache_stats_t* s);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // JBMP_CACHE_H
@@ -0,0 +1,392 @@
+// jbmp_fd.c
+
+/*
+jbmp_fd :: reading and writing .bmp images on file descriptors
+
+the pixel rows never go through a staging buffer: each row of the bitmap is
+one iovec, and the row padding is another that points at a shared block of
+zeros (or, when reading, a scratch block). since .bmp files store rows from
+the bottom up and the bitmap stores them top down, the pixel memory can't be
+sent as one block even when there is no padding, but each writev()/readv()
+still moves up to JBMP_FD_IOV_BATCH rows at once.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "jbmp.h"
+#include "jbmp_fd.h"
+
+static const uint8_t jbmp_fd_zeros[4] = { 0, 0, 0, 0 };
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                               RAW TRANSFERS                               *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// waits until 'fd' is ready; used when a non-blocking descriptor says EAGAIN
+static int jbmp_fd_wait(int fd, short events)
+{
+  struct pollfd p;
+  p.fd = fd;
+  p.events = events;
+  p.revents = 0;
+
+  while (poll(&p, 1, -1) < 0)
+  {
+    if (errno != EINTR) return -1;
+  }
+  return 0;
+}
+
+// steps over the first 'n' bytes of the iovec list, which have been moved
+static void jbmp_fd_advance(struct iovec** iov, int* cnt, size_t n)
+{
+  while (*cnt > 0 && n >= (*iov)->iov_len)
+  {
+    n -= (*iov)->iov_len;
+    (*iov)++;
+    (*cnt)--;
+  }
+  if (*cnt > 0)
+  {
+    (*iov)->iov_base = (uint8_t*)(*iov)->iov_base + n;
+    (*iov)->iov_len -= n;
+  }
+}
+
+// writes all of 'iov'; returns 0, or -1 with errno set
+static int jbmp_fd_writev_all(int fd, struct iovec* iov, int cnt)
+{
+  while (cnt > 0)
+  {
+    ssize_t n = writev(fd, iov, cnt);
+
+    if (n < 0)
+    {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        if (jbmp_fd_wait(fd, POLLOUT) != 0) return -1;
+        continue;
+      }
+      return -1;
+    }
+    jbmp_fd_advance(&iov, &cnt, (size_t)n);
+  }
+  return 0;
+}
+
+// fills all of 'iov'; returns 0, 1 on early EOF, or -1 with errno set
+static int jbmp_fd_readv_all(int fd, struct iovec* iov, int cnt)
+{
+  while (cnt > 0)
+  {
+    ssize_t n = readv(fd, iov, cnt);
+
+    if (n < 0)
+    {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        if (jbmp_fd_wait(fd, POLLIN) != 0) return -1;
+        continue;
+      }
+      return -1;
+    }
+    if (n == 0) return 1;
+    jbmp_fd_advance(&iov, &cnt, (size_t)n);
+  }
+  return 0;
+}
+
+static int jbmp_fd_read_all(int fd, void* buf, size_t len)
+{
+  struct iovec iov;
+  iov.iov_base = buf;
+  iov.iov_len = len;
+  return jbmp_fd_readv_all(fd, &iov, 1);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                              HEADER PACKING                               *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// .bmp headers are little-endian and unaligned, so they are packed and
+// unpacked a byte at a time rather than written straight from the struct.
+
+static void jbmp_fd_put16(uint8_t* p, uint16_t v)
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static void jbmp_fd_put32(uint8_t* p, uint32_t v)
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+static uint16_t jbmp_fd_get16(const uint8_t* p)
+{
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t jbmp_fd_get32(const uint8_t* p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+         ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void jbmp_fd_pack_header(uint8_t* p, jbmp_header_t* h)
+{
+  p[0] = h->magic[0];
+  p[1] = h->magic[1];
+  jbmp_fd_put32(p + 2, h->size_of_bmp);
+  jbmp_fd_put32(p + 6, h->resd1);
+  jbmp_fd_put32(p + 10, h->bitmap_offset);
+
+  jbmp_fd_put32(p + 14, h->size_of_header);
+  jbmp_fd_put32(p + 18, h->width);
+  jbmp_fd_put32(p + 22, h->height);
+  jbmp_fd_put16(p + 26, h->cplanes);
+  jbmp_fd_put16(p + 28, h->bpp);
+  jbmp_fd_put32(p + 30, h->comp_method);
+  jbmp_fd_put32(p + 34, h->image_size);
+  jbmp_fd_put32(p + 38, h->x_pixels_per_m);
+  jbmp_fd_put32(p + 42, h->y_pixels_per_m);
+  jbmp_fd_put32(p + 46, h->colors_used);
+  jbmp_fd_put32(p + 50, h->important_colors);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                              READ AND WRITE                               *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+int jbmp_write_fd(int fd, const jbmp_bitmap_t* b, int verbose)
+{
+  jbmp_header_t header;
+  uint8_t hbuf[JBMP_FD_HEADER_SIZE];
+  struct iovec iov[JBMP_FD_IOV_BATCH];
+  int cnt = 0;
+  int j;
+
+  int row_bytes = b->width * (int)sizeof(jbmp_pixel_t);
+  int row_pad_bytes = ((((b->width*3)+3)/4) * 4) - row_bytes;
+
+  jbmp_init_header(&header, b);
+  // the on-disk header is 54 bytes; sizeof(jbmp_header_t) includes padding
+  header.bitmap_offset = JBMP_FD_HEADER_SIZE;
+  header.size_of_bmp = JBMP_FD_HEADER_SIZE +
+                       ((row_bytes + row_pad_bytes) * b->height);
+  jbmp_fd_pack_header(hbuf, &header);
+
+  iov[cnt].iov_base = hbuf;
+  iov[cnt].iov_len = JBMP_FD_HEADER_SIZE;
+  cnt++;
+
+  // bmp files store rows from the bottom to top
+  for (j = b->height-1; j >= 0; j--)
+  {
+    // keep room for a row and its padding in the batch
+    if (cnt > JBMP_FD_IOV_BATCH - 2)
+    {
+      if (jbmp_fd_writev_all(fd, iov, cnt) != 0) break;
+      cnt = 0;
+    }
+
+    iov[cnt].iov_base = &b->bitmap[j * b->width];
+    iov[cnt].iov_len = (size_t)row_bytes;
+    cnt++;
+
+    if (row_pad_bytes > 0)
+    {
+      iov[cnt].iov_base = (void*)jbmp_fd_zeros;
+      iov[cnt].iov_len = (size_t)row_pad_bytes;
+      cnt++;
+    }
+  }
+
+  if (j >= 0 || jbmp_fd_writev_all(fd, iov, cnt) != 0)
+  {
+    if (verbose>0) printf("BMP write err: write to fd %i failed; errno = %i\n",
+                          fd, errno);
+    return JBMP_ERR_IO;
+  }
+
+  if (verbose>0) printf("BMP write: wrote %i bytes to fd %i.\n",
+                        header.size_of_bmp, fd);
+  return (int)header.size_of_bmp;
+}
+
+int jbmp_read_fd(int fd, jbmp_bitmap_t* b, int verbose)
+{
+  jbmp_header_t header;
+  uint8_t hbuf[JBMP_FD_HEADER_SIZE];
+  uint8_t pad[4];
+  struct iovec iov[JBMP_FD_IOV_BATCH];
+  uint32_t pos;
+  int cnt = 0;
+  int j, r;
+
+  memset(&header, 0, sizeof(jbmp_header_t));
+
+  // file header, plus the size of the info header that follows it
+  r = jbmp_fd_read_all(fd, hbuf, 18);
+  if (r != 0)
+  {
+    if (verbose>0) printf("BMP read err: cannot read header from fd %i.\n", fd);
+    return (r > 0) ? JBMP_ERR_SIZE_MISMATCH : JBMP_ERR_IO;
+  }
+  header.magic[0] = hbuf[0];
+  header.magic[1] = hbuf[1];
+  header.size_of_bmp = jbmp_fd_get32(hbuf + 2);
+  header.resd1 = jbmp_fd_get32(hbuf + 6);
+  header.bitmap_offset = jbmp_fd_get32(hbuf + 10);
+  header.size_of_header = jbmp_fd_get32(hbuf + 14);
+
+  if (header.magic[0] != 'B' || header.magic[1] != 'M')
+  {
+    if (verbose>0)
+    {
+      printf("BMP read err: bad magic number '%c%c'\n",
+             header.magic[0], header.magic[1]);
+    }
+    return JBMP_ERR_BAD_MAGIC;
+  }
+
+  if (header.size_of_header >= 40)   // indicates newer header
+  {
+    if (jbmp_fd_read_all(fd, hbuf + 18, 36) != 0)
+    {
+      return JBMP_ERR_SIZE_MISMATCH;
+    }
+    header.width = jbmp_fd_get32(hbuf + 18);
+    header.height = jbmp_fd_get32(hbuf + 22);
+    header.cplanes = jbmp_fd_get16(hbuf + 26);
+    header.bpp = jbmp_fd_get16(hbuf + 28);
+    header.comp_method = jbmp_fd_get32(hbuf + 30);
+    pos = 54;
+  }
+  else if (header.size_of_header >= 12)
+  {
+    if (jbmp_fd_read_all(fd, hbuf + 18, 8) != 0)
+    {
+      return JBMP_ERR_SIZE_MISMATCH;
+    }
+    header.width = jbmp_fd_get16(hbuf + 18);
+    header.height = jbmp_fd_get16(hbuf + 20);
+    header.cplanes = jbmp_fd_get16(hbuf + 22);
+    header.bpp = jbmp_fd_get16(hbuf + 24);
+    pos = 26;
+  }
+  else
+  {
+    if (verbose>0) printf("BMP read err: bad header size %i.\n",
+                          header.size_of_header);
+    return JBMP_ERR_BAD_FORMAT;
+  }
+
+  if (header.bpp != 24) // we can only read 24bpp images.
+  {
+    if (verbose>0) printf("BMP read err: cannot open %ibpp images.\n",
+                          header.bpp);
+    return JBMP_ERR_BAD_FORMAT;
+  }
+  else if (header.comp_method != 0)
+  {
+    if (verbose>0) printf("BMP read err: file is not uncompressed 24bpp.\n");
+    return JBMP_ERR_BAD_FORMAT;
+  }
+  else if (header.bitmap_offset < pos)
+  {
+    if (verbose>0)
+    {
+      printf("BMP read err: bitmap offset %u is inside the header.\n",
+             header.bitmap_offset);
+    }
+    return JBMP_ERR_BAD_FORMAT;
+  }
+
+  // check that we can accomodate the bitmap
+  uint64_t size_of_bitmap = 3 * ((uint64_t)header.width * header.height);
+  if (size_of_bitmap > JBMP_MAX_BITMAP_SIZE)
+  {
+    if (verbose>0)
+    {
+      printf("BMP read err: bitmap too large (%llu bytes).\n",
+             (unsigned long long)size_of_bitmap);
+    }
+    return JBMP_ERR_BITMAP_TOO_BIG;
+  }
+
+  // we can't seek, so read past whatever sits before the pixel data
+  // (palettes, extended header fields, gaps)
+  while (pos < header.bitmap_offset)
+  {
+    uint32_t n = header.bitmap_offset - pos;
+    if (n > sizeof(hbuf)) n = sizeof(hbuf);
+    if (jbmp_fd_read_all(fd, hbuf, n) != 0) return JBMP_ERR_SIZE_MISMATCH;
+    pos += n;
+  }
+
+  r = jbmp_init_bitmap(b, header.width, header.height, NULL);
+  if (r == JBMP_ERR_NOMEM)
+  {
+    if (verbose>0)
+    {
+      printf("BMP read err: cannot allocate sufficient memory (%llu bytes).\n",
+             (unsigned long long)size_of_bitmap);
+    }
+    return JBMP_ERR_NOMEM;
+  }
+
+  int row_bytes = b->width * (int)sizeof(jbmp_pixel_t);
+  int row_pad_bytes = ((((b->width*3)+3)/4) * 4) - row_bytes;
+
+  // bmp files store rows from the bottom to top
+  r = 0;
+  for (j = b->height-1; j >= 0 && r == 0; j--)
+  {
+    iov[cnt].iov_base = &b->bitmap[j * b->width];
+    iov[cnt].iov_len = (size_t)row_bytes;
+    cnt++;
+
+    if (row_pad_bytes > 0)
+    {
+      iov[cnt].iov_base = pad;
+      iov[cnt].iov_len = (size_t)row_pad_bytes;
+      cnt++;
+    }
+
+    if (cnt > JBMP_FD_IOV_BATCH - 2 || j == 0)
+    {
+      r = jbmp_fd_readv_all(fd, iov, cnt);
+      cnt = 0;
+    }
+  }
+
+  if (r != 0)
+  {
+    if (verbose>0)
+    {
+      if (r > 0) printf("BMP read err: size mismatch or early EOF.\n");
+      else printf("BMP read err: read from fd %i failed; errno = %i\n",
+                  fd, errno);
+    }
+    jbmp_free_bitmap(b);
+    return (r > 0) ? JBMP_ERR_SIZE_MISMATCH : JBMP_ERR_IO;
+  }
+
+  pos += (uint32_t)((row_bytes + row_pad_bytes) * b->height);
+  if (verbose>0) printf("BMP read: read %u bytes from fd %i.\n", pos, fd);
+  return (int)pos;
+}
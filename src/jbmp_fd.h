@@ -0,0 +1,77 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *    jbmp_fd: reading and writing .BMP images on POSIX file descriptors.    *
+ *                                                                           *
+ *    https://github.com/johngineer/jbmp                                     *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef JBMP_FD_H
+#define JBMP_FD_H
+
+#include "jbmp_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// the size of the header written by jbmp_write_fd(), in bytes
+#define JBMP_FD_HEADER_SIZE             54
+
+// the most iovecs handed to a single writev()/readv() call
+#define JBMP_FD_IOV_BATCH               256
+
+
+/* * * jbmp_write_fd() * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+
+writes 'b' as a complete .BMP image to the file descriptor 'fd', which may be
+a regular file, a pipe or a socket; it is never seeked. the pixel rows are
+passed to writev() straight from the bitmap's memory, interleaved with a
+shared block of zeros for the row padding, so no pixel data is copied.
+
+short writes are resumed where they stopped, EINTR is retried, and if 'fd'
+is non-blocking we poll() until it can take more. writing to a closed pipe
+or socket raises SIGPIPE unless the caller has ignored it.
+
+ int fd -------------------- the file descriptor, open for writing.
+ const jbmp_bitmap_t* b ---- pointer to the bitmap struct to write.
+ int verbose --------------- verbosity flag (0 = silent, >=1 = loud).
+
+ returns (int):
+   on failure: an error code
+   on success: the number of bytes written
+
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int jbmp_write_fd(int fd, const jbmp_bitmap_t* b, int verbose);
+
+
+/* * * jbmp_read_fd()  * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+
+reads one .BMP image from the file descriptor 'fd' into 'b', which is
+initialized to the size given in the header. 'fd' is only ever read
+forward, so pipes and sockets work; anything between the header and the
+pixel data is read and thrown away, and nothing past the last row is read.
+the rows are read with readv() directly into the bitmap's memory.
+
+short reads, EINTR and non-blocking descriptors are handled as in
+jbmp_write_fd(). 'b' is left unmodified if the header can't be read or is
+rejected; if reading the pixel rows fails, 'b' is freed and left empty.
+
+ int fd -------------------- the file descriptor, open for reading.
+ jbmp_bitmap_t* b ---------- pointer to the bitmap struct where we put the
+                               bitmap data.
+ int verbose --------------- verbosity flag (0 = silent, >=1 = loud).
+
+ returns (int):
+   on failure: an error code
+   on success: the number of bytes read
+
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+int jbmp_read_fd(int fd, jbmp_bitmap_t* b, int verbose);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // JBMP_FD_H
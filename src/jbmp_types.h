@@ -32,9 +32,19 @@ typedef struct jbmp_bitmap_t
   int size_bytes;  //
   jbmp_pixel_t* bitmap;
   char* filename;
+  unsigned char* dirty_rows; // one bit per row; NULL if not tracking
 
 } jbmp_bitmap_t;
 
+// running state of a content hash (see jbmp_hash_init() in jbmp.h)
+typedef struct jbmp_hash_state_t
+{
+  uint64_t acc;
+  int width;
+  int height;
+
+} jbmp_hash_state_t;
+
 // the header we read in to verify and learn more about the .BMP file
 // this struct uses inttypes.h types because specific bit-width is required.
 typedef struct jbmp_header_t